@@ -30,6 +30,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
 
 const static constexpr char* CurrentBootCycleCountName =
     "CurrentBootCycleCount";
@@ -64,6 +65,15 @@ using post_code =
 using delete_all =
     sdbusplus::xyz::openbmc_project::Collection::server::DeleteAll;
 
+std::vector<uint8_t> decodeHexString(const std::string& hex);
+
+// Post code archive storage, shared with the offline post-code-tool.
+bool serializePostCodes(const fs::path& path,
+                        const std::map<uint64_t, postcode_t>& codes);
+bool deserializeUint16(const fs::path& path, uint16_t& value);
+bool deserializePostCodes(const fs::path& path,
+                          std::map<uint64_t, postcode_t>& codes);
+
 struct PostCodeEvent
 {
     std::string name;
@@ -71,22 +81,68 @@ struct PostCodeEvent
     void raise() const;
 };
 
+struct PostCodeSequenceStep
+{
+    primarycode_t primary;
+    std::optional<secondarycode_t> secondary;
+    uint16_t count = 1;
+    bool matches(const postcode_t& code) const;
+};
+
 struct PostCodeHandler
 {
     std::string name;
     std::string description;
     primarycode_t primary;
     std::optional<secondarycode_t> secondary;
+    // When non-empty the handler fires on this ordered sequence of post
+    // codes instead of on a single primary/secondary match.
+    std::vector<PostCodeSequenceStep> sequence;
+    std::optional<std::chrono::microseconds> window;
     std::vector<std::string> targets;
     std::optional<PostCodeEvent> event;
 };
 
+// A partially matched sequence handler: the step it is waiting on, how many
+// times that step has been seen and when the first code of the sequence was
+// received.
+struct PostCodeSequenceState
+{
+    size_t handler;
+    size_t step;
+    uint16_t count;
+    uint64_t startUs;
+};
+
 struct PostCodeHandlers
 {
-    std::vector<PostCodeHandler> handlers;
-    void handle(postcode_t code);
+    void handle(postcode_t code, uint64_t tsUS);
+    std::vector<const PostCodeHandler*> match(const postcode_t& code,
+                                              uint64_t tsUS);
+    void run(const PostCodeHandler& handler) const;
     const PostCodeHandler* find(postcode_t code);
+    void reset();
     void load(const std::string& path);
+
+  private:
+    void compile();
+    std::vector<size_t> advance(const postcode_t& code, uint64_t tsUS);
+
+    // Only set through load() so the indices below always match it.
+    std::vector<PostCodeHandler> handlers;
+
+    // Sequence handlers indexed by the primary code of their first step.
+    std::map<primarycode_t, std::vector<size_t>> sequenceStarts;
+    // Partial matches, swapped with next on every post code so the buffers
+    // are reused rather than reallocated.
+    std::vector<PostCodeSequenceState> active;
+    std::vector<PostCodeSequenceState> next;
+    // One slot per (handler, step, count), holding the position of that
+    // partial match in next while a post code is being processed.
+    static constexpr size_t noSlot = std::numeric_limits<size_t>::max();
+    std::vector<std::vector<size_t>> stepSlots;
+    std::vector<size_t> slots;
+    std::vector<bool> fired;
 };
 
 struct PostCode : sdbusplus::server::object_t<post_code, delete_all>
@@ -151,7 +207,8 @@ struct PostCode : sdbusplus::server::object_t<post_code, delete_all>
             "PostCode is created");
         fs::create_directories(postCodeListPath);
         uint16_t version = 0;
-        if (!deserialize(postCodeListPath / PostCodeDataVersionName, version) ||
+        if (!deserializeUint16(postCodeListPath / PostCodeDataVersionName,
+                               version) ||
             version != PostCodeDataVersion)
         {
             phosphor::logging::log<phosphor::logging::level::INFO>(
@@ -164,10 +221,11 @@ struct PostCode : sdbusplus::server::object_t<post_code, delete_all>
         }
         else
         {
-            deserialize(postCodeListPath / CurrentBootCycleIndexName,
-                        currentBootCycleIndex);
+            deserializeUint16(postCodeListPath / CurrentBootCycleIndexName,
+                              currentBootCycleIndex);
             uint16_t count = 0;
-            deserialize(postCodeListPath / CurrentBootCycleCountName, count);
+            deserializeUint16(postCodeListPath / CurrentBootCycleCountName,
+                              count);
             currentBootCycleCount(count);
         }
         maxBootCycleNum(MAX_BOOT_CYCLE_COUNT);
@@ -197,8 +255,5 @@ struct PostCode : sdbusplus::server::object_t<post_code, delete_all>
 
     void savePostCodes(postcode_t code);
     fs::path serialize(const fs::path& path);
-    bool deserialize(const fs::path& path, uint16_t& index);
-    bool deserializePostCodes(const fs::path& path,
-                              std::map<uint64_t, postcode_t>& codes);
     PostCodeHandlers postCodeHandlers;
 };
@@ -25,7 +25,9 @@
 #include <sdbusplus/bus.hpp>
 #include <sdbusplus/exception.hpp>
 
+#include <algorithm>
 #include <iomanip>
+#include <limits>
 
 using nlohmann::json;
 
@@ -83,18 +85,71 @@ std::vector<uint8_t> decodeHexString(const std::string& hex)
     return out;
 }
 
-void from_json(const json& j, PostCodeHandler& handler)
+void from_json(const json& j, PostCodeSequenceStep& step)
 {
     std::string primary;
-    j.at("name").get_to(handler.name);
-    j.at("description").get_to(handler.description);
     j.at("primary").get_to(primary);
-    handler.primary = decodeHexString(primary);
+    step.primary = decodeHexString(primary);
     if (j.contains("secondary"))
     {
         std::string secondary;
         j.at("secondary").get_to(secondary);
-        handler.secondary = decodeHexString(secondary);
+        step.secondary = decodeHexString(secondary);
+    }
+    if (j.contains("count"))
+    {
+        uint64_t count = j.at("count").get<uint64_t>();
+        if (count < 1 || count > std::numeric_limits<uint16_t>::max())
+        {
+            throw std::runtime_error("Bad sequence count: " +
+                                     std::to_string(count));
+        }
+        step.count = static_cast<uint16_t>(count);
+    }
+}
+
+void from_json(const json& j, PostCodeHandler& handler)
+{
+    j.at("name").get_to(handler.name);
+    j.at("description").get_to(handler.description);
+    if (j.contains("sequence"))
+    {
+        if (j.contains("primary") || j.contains("secondary"))
+        {
+            throw std::runtime_error(
+                "Handler has both primary and sequence: " + handler.name);
+        }
+        j.at("sequence").get_to(handler.sequence);
+        if (handler.sequence.empty())
+        {
+            throw std::runtime_error("Empty sequence: " + handler.name);
+        }
+        if (j.contains("window_ms"))
+        {
+            uint64_t window = j.at("window_ms").get<uint64_t>();
+            if (window < 1)
+            {
+                throw std::runtime_error("Bad window_ms: " + handler.name);
+            }
+            handler.window = std::chrono::milliseconds(window);
+        }
+    }
+    else
+    {
+        if (j.contains("window_ms"))
+        {
+            throw std::runtime_error("window_ms without sequence: " +
+                                     handler.name);
+        }
+        std::string primary;
+        j.at("primary").get_to(primary);
+        handler.primary = decodeHexString(primary);
+        if (j.contains("secondary"))
+        {
+            std::string secondary;
+            j.at("secondary").get_to(secondary);
+            handler.secondary = decodeHexString(secondary);
+        }
     }
     if (j.contains("targets"))
     {
@@ -108,10 +163,20 @@ void from_json(const json& j, PostCodeHandler& handler)
     }
 }
 
+bool PostCodeSequenceStep::matches(const postcode_t& code) const
+{
+    return primary == std::get<0>(code) &&
+           (!secondary || *secondary == std::get<1>(code));
+}
+
 const PostCodeHandler* PostCodeHandlers::find(postcode_t code)
 {
     for (const auto& handler : handlers)
     {
+        if (!handler.sequence.empty())
+        {
+            continue;
+        }
         if (handler.primary == std::get<0>(code) &&
             (!handler.secondary || *handler.secondary == std::get<1>(code)))
         {
@@ -121,14 +186,116 @@ const PostCodeHandler* PostCodeHandlers::find(postcode_t code)
     return nullptr;
 }
 
-void PostCodeHandlers::handle(postcode_t code)
+// Feed one post code into a partially matched sequence. Returns true once
+// the last step of the sequence has been completed.
+static bool consume(const PostCodeHandler& handler,
+                    PostCodeSequenceState& state, const postcode_t& code)
+{
+    const auto& step = handler.sequence[state.step];
+    if (!step.matches(code) || ++state.count < step.count)
+    {
+        return false;
+    }
+    state.count = 0;
+    return ++state.step == handler.sequence.size();
+}
+
+std::vector<size_t> PostCodeHandlers::advance(const postcode_t& code,
+                                              uint64_t tsUS)
+{
+    std::vector<size_t> completed;
+    next.clear();
+
+    // Two partial matches waiting on the same step behave identically from
+    // now on, except that the most recently started one expires last. Each
+    // (handler, step, count) has its own slot, so keep only the newest state
+    // per slot. This bounds the number of active states by the size of the
+    // configured sequences without sorting.
+    auto feed = [&](PostCodeSequenceState state) {
+        const auto& handler = handlers[state.handler];
+        if (handler.window &&
+            std::chrono::microseconds(tsUS - state.startUs) > *handler.window)
+        {
+            return;
+        }
+        if (consume(handler, state, code))
+        {
+            if (!fired[state.handler])
+            {
+                fired[state.handler] = true;
+                completed.push_back(state.handler);
+            }
+            return;
+        }
+        size_t& pos = slots[stepSlots[state.handler][state.step] + state.count];
+        if (pos == noSlot)
+        {
+            pos = next.size();
+            next.push_back(state);
+        }
+        else if (next[pos].startUs < state.startUs)
+        {
+            next[pos] = state;
+        }
+    };
+
+    for (const auto& state : active)
+    {
+        feed(state);
+    }
+
+    // Only sequences whose first step is this code can start here.
+    auto starts = sequenceStarts.find(std::get<0>(code));
+    if (starts != sequenceStarts.end())
+    {
+        for (size_t index : starts->second)
+        {
+            if (handlers[index].sequence.front().matches(code))
+            {
+                feed({index, 0, 0, tsUS});
+            }
+        }
+    }
+
+    for (const auto& state : next)
+    {
+        slots[stepSlots[state.handler][state.step] + state.count] = noSlot;
+    }
+
+    // A handler fires once per match, drop its other partial matches.
+    if (!completed.empty())
+    {
+        std::erase_if(next, [&](const PostCodeSequenceState& state) {
+            return fired[state.handler];
+        });
+        for (size_t index : completed)
+        {
+            fired[index] = false;
+        }
+    }
+
+    std::swap(active, next);
+    return completed;
+}
+
+std::vector<const PostCodeHandler*> PostCodeHandlers::match(
+    const postcode_t& code, uint64_t tsUS)
 {
-    const PostCodeHandler* handler = find(code);
-    if (!handler)
+    std::vector<const PostCodeHandler*> matched;
+    if (const PostCodeHandler* handler = find(code))
     {
-        return;
+        matched.push_back(handler);
     }
-    for (const auto& target : handler->targets)
+    for (size_t index : advance(code, tsUS))
+    {
+        matched.push_back(&handlers[index]);
+    }
+    return matched;
+}
+
+void PostCodeHandlers::run(const PostCodeHandler& handler) const
+{
+    for (const auto& target : handler.targets)
     {
         auto bus = sdbusplus::bus::new_default();
         auto method = bus.new_method_call(SYSTEMD_SERVICE, SYSTEMD_ROOT,
@@ -137,17 +304,56 @@ void PostCodeHandlers::handle(postcode_t code)
         method.append("replace");
         bus.call_noreply(method);
     }
-    if (handler->event)
+    if (handler.event)
     {
-        (*(handler->event)).raise();
+        (*(handler.event)).raise();
     }
 }
 
+void PostCodeHandlers::handle(postcode_t code, uint64_t tsUS)
+{
+    for (const PostCodeHandler* handler : match(code, tsUS))
+    {
+        run(*handler);
+    }
+}
+
+void PostCodeHandlers::reset()
+{
+    active.clear();
+}
+
+void PostCodeHandlers::compile()
+{
+    sequenceStarts.clear();
+    active.clear();
+    next.clear();
+    stepSlots.assign(handlers.size(), {});
+    fired.assign(handlers.size(), false);
+    size_t slotCount = 0;
+    for (size_t index = 0; index < handlers.size(); index++)
+    {
+        const auto& sequence = handlers[index].sequence;
+        if (sequence.empty())
+        {
+            continue;
+        }
+        sequenceStarts[sequence.front().primary].push_back(index);
+        for (const auto& step : sequence)
+        {
+            stepSlots[index].push_back(slotCount);
+            slotCount += step.count;
+        }
+    }
+    slots.assign(slotCount, noSlot);
+}
+
 void PostCodeHandlers::load(const std::string& path)
 {
     std::ifstream ifs(path);
     handlers = json::parse(ifs).template get<std::vector<PostCodeHandler>>();
     ifs.close();
+    compile();
 }
 
 void PostCode::deleteAll()
@@ -216,6 +422,7 @@ void PostCode::savePostCodes(postcode_t code)
         firstPostCodeTimeSteady = postCodeTimeSteady;
         firstPostCodeUsSinceEpoch = tsUS; // uS since epoch for 1st post code
         incrBootCycle();
+        postCodeHandlers.reset();
     }
     else
     {
@@ -276,7 +483,7 @@ void PostCode::savePostCodes(postcode_t code)
             "REDFISH_MESSAGE_ARGS=%d,%s,%s", currentBootCycleIndex,
             timeOffsetStr.str().c_str(), hexCode.str().c_str()));
 #endif
-    postCodeHandlers.handle(code);
+    postCodeHandlers.handle(code, tsUS);
 
     return;
 }
@@ -294,9 +501,11 @@ fs::path PostCode::serialize(const fs::path& path)
         cereal::BinaryOutputArchive cntArchive(osCnt);
         cntArchive(count);
 
-        std::ofstream osPostCodes(path / std::to_string(currentBootCycleIndex));
-        cereal::BinaryOutputArchive oarchivePostCodes(osPostCodes);
-        oarchivePostCodes(postCodes);
+        if (!serializePostCodes(path / std::to_string(currentBootCycleIndex),
+                                postCodes))
+        {
+            return "";
+        }
 
         std::ofstream osVersion(path / PostCodeDataVersionName,
                                 std::ios::binary);
@@ -316,7 +525,24 @@ fs::path PostCode::serialize(const fs::path& path)
     return path;
 }
 
-bool PostCode::deserialize(const fs::path& path, uint16_t& index)
+bool serializePostCodes(const fs::path& path,
+                        const std::map<uint64_t, postcode_t>& codes)
+{
+    try
+    {
+        std::ofstream os(path, std::ios::binary);
+        cereal::BinaryOutputArchive oarchive(os);
+        oarchive(codes);
+        return true;
+    }
+    catch (const cereal::Exception& e)
+    {
+        phosphor::logging::log<phosphor::logging::level::ERR>(e.what());
+        return false;
+    }
+}
+
+bool deserializeUint16(const fs::path& path, uint16_t& value)
 {
     try
     {
@@ -324,7 +550,7 @@ bool PostCode::deserialize(const fs::path& path, uint16_t& index)
         {
             std::ifstream is(path, std::ios::in | std::ios::binary);
             cereal::BinaryInputArchive iarchive(is);
-            iarchive(index);
+            iarchive(value);
             return true;
         }
         return false;
@@ -342,8 +568,8 @@ bool PostCode::deserialize(const fs::path& path, uint16_t& index)
     return false;
 }
 
-bool PostCode::deserializePostCodes(const fs::path& path,
-                                    std::map<uint64_t, postcode_t>& codes)
+bool deserializePostCodes(const fs::path& path,
+                          std::map<uint64_t, postcode_t>& codes)
 {
     try
     {
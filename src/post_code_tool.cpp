@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "post_code.hpp"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+using nlohmann::json;
+
+struct BootCycle
+{
+    std::string name;
+    std::map<uint64_t, postcode_t> codes;
+};
+
+static std::string encodeHexString(const std::vector<uint8_t>& bytes)
+{
+    std::ostringstream hex;
+    hex << "0x" << std::setfill('0') << std::hex;
+    for (const auto& byte : bytes)
+    {
+        hex << std::setw(2) << static_cast<int>(byte);
+    }
+    return hex.str();
+}
+
+static bool isJson(const fs::path& path)
+{
+    return path.extension() == ".json";
+}
+
+static json toJson(const std::map<uint64_t, postcode_t>& codes)
+{
+    json j = json::array();
+    for (const auto& [tsUS, code] : codes)
+    {
+        json entry = {{"timestamp_us", tsUS},
+                      {"primary", encodeHexString(std::get<0>(code))}};
+        if (!std::get<1>(code).empty())
+        {
+            entry["secondary"] = encodeHexString(std::get<1>(code));
+        }
+        j.push_back(entry);
+    }
+    return j;
+}
+
+static std::map<uint64_t, postcode_t> fromJson(const json& j)
+{
+    std::map<uint64_t, postcode_t> codes;
+    for (const auto& entry : j)
+    {
+        secondarycode_t secondary;
+        if (entry.contains("secondary"))
+        {
+            secondary =
+                decodeHexString(entry.at("secondary").get<std::string>());
+        }
+        codes.emplace(
+            entry.at("timestamp_us").get<uint64_t>(),
+            postcode_t{decodeHexString(entry.at("primary").get<std::string>()),
+                       secondary});
+    }
+    return codes;
+}
+
+static std::map<uint64_t, postcode_t> readArchive(const fs::path& path)
+{
+    std::map<uint64_t, postcode_t> codes;
+    if (isJson(path))
+    {
+        std::ifstream ifs(path);
+        return fromJson(json::parse(ifs));
+    }
+    if (!deserializePostCodes(path, codes))
+    {
+        throw std::runtime_error("Failed to read archive: " + path.string());
+    }
+    return codes;
+}
+
+static void writeArchive(const fs::path& path,
+                         const std::map<uint64_t, postcode_t>& codes)
+{
+    if (isJson(path))
+    {
+        std::ofstream ofs(path);
+        ofs << toJson(codes).dump(4) << std::endl;
+        if (!ofs)
+        {
+            throw std::runtime_error("Failed to write: " + path.string());
+        }
+        return;
+    }
+    if (!serializePostCodes(path, codes))
+    {
+        throw std::runtime_error("Failed to write archive: " + path.string());
+    }
+}
+
+// Archives pulled off a failed BMC may be half written, skip those rather
+// than losing every other boot cycle.
+static void readCycle(const fs::path& path, std::vector<BootCycle>& cycles)
+{
+    BootCycle cycle{path.filename().string(), {}};
+    try
+    {
+        cycle.codes = readArchive(path);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Skipping " << path.string() << ": " << e.what()
+                  << std::endl;
+        return;
+    }
+    if (!cycle.codes.empty())
+    {
+        cycles.push_back(std::move(cycle));
+    }
+}
+
+// A host directory holds one archive per boot cycle, named after the boot
+// cycle index it was recorded at. Walk them oldest first using the same
+// wrap around as PostCode::getBootNum(). If the index files are gone, fall
+// back to ordering by the time of the first post code, which is less
+// reliable since that time comes from the BMC's wall clock. The tool must be
+// built with the same max-boot-cycle-count as the BMC the archives came from.
+static std::vector<BootCycle> readCycles(const fs::path& path)
+{
+    std::vector<BootCycle> cycles;
+    if (!fs::is_directory(path))
+    {
+        cycles.push_back({path.filename().string(), readArchive(path)});
+        return cycles;
+    }
+
+    uint16_t currentIndex = 0;
+    uint16_t count = 0;
+    if (deserializeUint16(path / CurrentBootCycleIndexName, currentIndex) &&
+        deserializeUint16(path / CurrentBootCycleCountName, count) &&
+        currentIndex > 0 && currentIndex <= MAX_BOOT_CYCLE_COUNT)
+    {
+        count = std::min<uint16_t>(count, MAX_BOOT_CYCLE_COUNT);
+        for (uint16_t index = count; index > 0; index--)
+        {
+            uint16_t bootNum = currentIndex - index + 1;
+            if (index > currentIndex)
+            {
+                bootNum = (MAX_BOOT_CYCLE_COUNT + currentIndex) - index + 1;
+            }
+            fs::path cyclePath = path / std::to_string(bootNum);
+            if (fs::exists(cyclePath))
+            {
+                readCycle(cyclePath, cycles);
+            }
+        }
+        return cycles;
+    }
+
+    std::cerr << "Boot cycle index missing, ordering boot cycles by time"
+              << std::endl;
+    for (const auto& entry : fs::directory_iterator(path))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.empty() || !std::ranges::all_of(name, [](unsigned char c) {
+                return std::isdigit(c);
+            }))
+        {
+            continue;
+        }
+        readCycle(entry.path(), cycles);
+    }
+    std::ranges::sort(cycles, {}, [](const BootCycle& cycle) {
+        return cycle.codes.begin()->first;
+    });
+    return cycles;
+}
+
+static std::string formatOffset(uint64_t usTimeOffset)
+{
+    std::ostringstream timeOffsetStr;
+    timeOffsetStr << std::fixed << std::setprecision(4)
+                  << static_cast<double>(usTimeOffset) / 1000 / 1000;
+    return timeOffsetStr.str();
+}
+
+static void printValue(const char* name, bool valid, uint16_t value)
+{
+    std::cout << name << ": ";
+    if (valid)
+    {
+        std::cout << value << "\n";
+    }
+    else
+    {
+        std::cout << "missing/unreadable\n";
+    }
+}
+
+static void dump(const fs::path& path, const std::vector<BootCycle>& cycles)
+{
+    if (fs::is_directory(path))
+    {
+        uint16_t version = 0;
+        bool hasVersion =
+            deserializeUint16(path / PostCodeDataVersionName, version);
+        printValue(PostCodeDataVersionName, hasVersion, version);
+        if (hasVersion && version != PostCodeDataVersion)
+        {
+            std::cerr << "Warning: data version " << version
+                      << " is not supported (expected " << PostCodeDataVersion
+                      << "), the service would discard this data" << std::endl;
+        }
+        for (const char* name :
+             {CurrentBootCycleIndexName, CurrentBootCycleCountName})
+        {
+            uint16_t value = 0;
+            printValue(name, deserializeUint16(path / name, value), value);
+        }
+    }
+
+    for (const auto& cycle : cycles)
+    {
+        std::cout << "Boot cycle " << cycle.name << ": " << cycle.codes.size()
+                  << " post codes\n";
+        if (cycle.codes.empty())
+        {
+            continue;
+        }
+        uint64_t firstUS = cycle.codes.begin()->first;
+        for (const auto& [tsUS, code] : cycle.codes)
+        {
+            std::cout << "  " << formatOffset(tsUS - firstUS) << " "
+                      << encodeHexString(std::get<0>(code));
+            if (!std::get<1>(code).empty())
+            {
+                std::cout << " " << encodeHexString(std::get<1>(code));
+            }
+            std::cout << "\n";
+        }
+    }
+}
+
+// Feed every boot cycle through the handlers with the archived timestamps.
+// Handler actions are not run, matches are only reported. A speed of 0
+// replays as fast as possible, otherwise the original timing is scaled down
+// by the given factor.
+static void replay(PostCodeHandlers& handlers,
+                   const std::vector<BootCycle>& cycles, double speed)
+{
+    struct Match
+    {
+        uint64_t tsUS;
+        const postcode_t* code;
+        const PostCodeHandler* handler;
+    };
+    std::map<std::string, size_t> matchCount;
+    std::vector<Match> matches;
+    size_t codeCount = 0;
+    std::chrono::steady_clock::duration busy{};
+
+    for (const auto& cycle : cycles)
+    {
+        std::cout << "Boot cycle " << cycle.name << ": " << cycle.codes.size()
+                  << " post codes\n";
+        handlers.reset();
+        if (cycle.codes.empty())
+        {
+            continue;
+        }
+        uint64_t firstUS = cycle.codes.begin()->first;
+        matches.clear();
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& [tsUS, code] : cycle.codes)
+        {
+            std::vector<const PostCodeHandler*> matched;
+            if (speed > 0)
+            {
+                std::this_thread::sleep_until(
+                    start + std::chrono::duration_cast<
+                                std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double, std::micro>(
+                                    (tsUS - firstUS) / speed)));
+                auto before = std::chrono::steady_clock::now();
+                matched = handlers.match(code, tsUS);
+                busy += std::chrono::steady_clock::now() - before;
+            }
+            else
+            {
+                matched = handlers.match(code, tsUS);
+            }
+            for (const PostCodeHandler* handler : matched)
+            {
+                matches.push_back({tsUS, &code, handler});
+            }
+        }
+        // Without pacing the whole cycle is timed at once, reading the
+        // clock around every match() would mostly measure the clock.
+        if (speed == 0)
+        {
+            busy += std::chrono::steady_clock::now() - start;
+        }
+        codeCount += cycle.codes.size();
+
+        for (const auto& match : matches)
+        {
+            std::cout << "  " << formatOffset(match.tsUS - firstUS) << " "
+                      << encodeHexString(std::get<0>(*match.code)) << " -> "
+                      << match.handler->name << "\n";
+            matchCount[match.handler->name]++;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(busy).count();
+    std::cout << "Replayed " << codeCount << " post codes from "
+              << cycles.size() << " boot cycles in " << std::fixed
+              << std::setprecision(6) << seconds << "s of handler time";
+    if (seconds > 0)
+    {
+        std::cout << " (" << std::setprecision(0) << codeCount / seconds
+                  << " post codes/s)";
+    }
+    std::cout << "\n";
+    if (speed > 0)
+    {
+        std::cout << "Paced replay times each post code on its own, the "
+                     "handler time is an upper bound\n";
+    }
+    for (const auto& [name, count] : matchCount)
+    {
+        std::cout << "  " << name << ": " << count << " matches\n";
+    }
+}
+
+static bool parseSpeed(const char* arg, double& speed)
+{
+    std::string_view str(arg);
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(),
+                                     speed);
+    return ec == std::errc() && ptr == str.data() + str.size() &&
+           std::isfinite(speed) && speed >= 0;
+}
+
+static void usage(const char* name)
+{
+    std::cerr
+        << "Usage: " << name << " [OPTIONS] PATH\n"
+        << "Inspect post code archives offline. PATH is either a single boot\n"
+        << "cycle archive or a host directory, such as "
+        << PostCodeListPathPrefix << "0.\n"
+        << "Archives ending in .json are read and written as JSON.\n\n"
+        << "  -o, --output FILE   Convert a single archive to FILE\n"
+        << "  -c, --config FILE   Replay through the handlers in FILE\n"
+        << "  -s, --speed FACTOR  Replay at FACTOR times the original speed,\n"
+        << "                      0 replays as fast as possible (default)\n"
+        << "  -h, --help          Show this help\n"
+        << "Without -o or -c the archive is dumped to stdout. -o cannot be\n"
+        << "combined with -c, and -s requires -c.\n";
+}
+
+int main(int argc, char* argv[])
+{
+    int arg;
+    int optIndex = 0;
+    std::string output;
+    std::string config;
+    double speed = 0;
+    bool hasSpeed = false;
+
+    static struct option longOpts[] = {{"output", required_argument, 0, 'o'},
+                                       {"config", required_argument, 0, 'c'},
+                                       {"speed", required_argument, 0, 's'},
+                                       {"help", no_argument, 0, 'h'},
+                                       {0, 0, 0, 0}};
+
+    while ((arg = getopt_long(argc, argv, "o:c:s:h", longOpts, &optIndex)) !=
+           -1)
+    {
+        switch (arg)
+        {
+            case 'o':
+                output = optarg;
+                break;
+            case 'c':
+                config = optarg;
+                break;
+            case 's':
+                if (!parseSpeed(optarg, speed))
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                hasSpeed = true;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    // Conversion does not replay, and only a replay can be paced.
+    if (optind != argc - 1 || (!output.empty() && !config.empty()) ||
+        (hasSpeed && config.empty()))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    fs::path path = argv[optind];
+
+    try
+    {
+        if (!output.empty())
+        {
+            if (fs::is_directory(path))
+            {
+                std::cerr << "Only a single archive can be converted"
+                          << std::endl;
+                return -1;
+            }
+            writeArchive(output, readArchive(path));
+            return 0;
+        }
+
+        std::vector<BootCycle> cycles = readCycles(path);
+        if (config.empty())
+        {
+            dump(path, cycles);
+            return 0;
+        }
+
+        PostCodeHandlers handlers;
+        handlers.load(config);
+        replay(handlers, cycles, speed);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}